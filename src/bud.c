@@ -17,17 +17,34 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/stat.h>
 #define ARGPARSER_IMPLEMENTATION
 #include "Argparser.h"
 
+// MSVC only defines the file type masks
+#ifndef S_ISREG
+#define S_ISREG(mode) (((mode) & S_IFMT) == S_IFREG)
+#endif
+
 #ifdef _WIN32
 #include <windows.h>
+#include <io.h>
+#define isatty _isatty
+#define realpath(path, resolved) _fullpath((resolved), (path), _MAX_PATH)
 static char* HORIZONTAL_LIGN = "-";
 static char* CHART_FILLER = "#";
 static char* CHART_BORDER_LEFT = "|";
 static char* CHART_BORDER_RIGHT = "|";
 #else
 #include <sys/ioctl.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <unistd.h>
 static char* HORIZONTAL_LIGN = "─";
 static char* CHART_FILLER = "▆";
 static char* CHART_BORDER_LEFT = "▕";
@@ -37,7 +54,19 @@ static char* CHART_BORDER_RIGHT = "▏";
 
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 #define min(a,b) (((a) < (b)) ? (a) : (b))
-#define abs(a)   (((a) >= 0) ? (a) : -(a))
+
+// Cents are accumulated exactly in 128 bit where the compiler supports it
+#ifdef __SIZEOF_INT128__
+typedef __int128 money;
+typedef unsigned __int128 umoney;
+#define MONEY_MAX ((money)(((umoney)1 << 127) - 1))
+#else
+typedef long long money;
+typedef unsigned long long umoney;
+#define MONEY_MAX LLONG_MAX
+#endif
+#define MONEY_MIN (-MONEY_MAX - 1)
+#define MONEY_LENGTH 48
 
 #define ANSI_COLOR_RED      "\x1b[31m"
 #define ANSI_COLOR_GREEN    "\x1b[32m"
@@ -45,9 +74,16 @@ static char* CHART_BORDER_RIGHT = "▏";
 
 const int MAX_CHART_SIZE = 100;
 const int CHART_OFFSET = 15 + 1 + 9 + 1;
+const int COMPARISON_WIDTH = 15 + 3 * (1 + 9);
 const int BUFFERSIZE = 256;
-const char *SEPARATOR_CSV = " \t";
+const char *SEPARATOR_CSV = " \t\r\n";
 const char *SEPARATOR_CURRENCY = ",.";
+#define SPILL_PARTITIONS 16
+#define SPILL_LINESIZE 512
+#define SPILL_FAN_IN 16
+#define SPILL_MIN_BUCKETS 64
+#define PARSE_ERROR_BATCH 64
+#define MAX_WALK_THREADS 8
 
 // Input variables
 int inverse = 0;
@@ -55,19 +91,196 @@ int nochart = 0;
 int colorOutput = 0;
 int noheader = 0;
 int nototal = 0;
+const char *memLimitArg = NULL;
+size_t memLimit = 0;
+const char *rollingArg = NULL;
+const char *compareArg = NULL;
+int rollingMonths = 0;
+int maxErrors = 100;
+const char *recursiveDir = NULL;
+const char *fileGlob = "*.txt";
+int diffMode = 0;
+int interactive = 0;
+int fixedChartwidth = 0;
+const char *cacheDir = NULL;
 
 // Data structure for categories
 typedef struct bucket
 {
     char *category;
-    long totalCents;
-    struct bucket *nextBucket;
+    money totalCents;
+    unsigned long long hash;
+    long firstSeen;             // Creation order, restores the output order after spilling
+    money *monthCents;          // Totals per month, prefix sums after buildPrefixSums()
+    int firstMonth;
+    int monthCount;
+    struct bucket *nextBucket;  // Newest category first
+    struct bucket *nextInSlot;  // Chain inside the hash table
 } bucket;
-bucket* buckets;
+
+// Hash index over all buckets; `bytes` is compared against --mem-limit
+typedef struct bucketTable
+{
+    bucket *first;
+    bucket **slots;
+    size_t slotCount;
+    size_t count;
+    size_t bytes;
+} bucketTable;
+bucketTable buckets;
+long bucketSequence = 0;
+
+// A spilled run holds sorted buckets for every hash partition of a temporary file
+typedef struct spillRun
+{
+    FILE *file;
+    int level;                  // Number of compactions behind this run
+    long offsets[SPILL_PARTITIONS];
+    long counts[SPILL_PARTITIONS];
+} spillRun;
+spillRun *spillRuns = NULL;
+int spillRunCount = 0;
+
+// Reads the records of one partition of a spilled run
+typedef struct spillCursor
+{
+    FILE *file;
+    long remaining;
+    long firstSeen;
+    money cents;
+    char *category;
+    char line[SPILL_LINESIZE];
+} spillCursor;
+typedef int spillOrder(const spillCursor *a, const spillCursor *b);
+typedef void spillEmit(const spillCursor *cursor);
+
+// Merged buckets waiting to be printed in their original order
+bucket **results = NULL;
+size_t resultCount = 0;
+size_t resultCapacity = 0;
+size_t resultBytes = 0;
+spillRun *resultRuns = NULL;
+int resultRunCount = 0;
+
+// Destination of merged records while runs are compacted, NULL during the final merge
+spillRun *mergeTarget = NULL;
+int mergePartition = 0;
+
+// Months are counted as year * 12 + month - 1, only tracked for period reports
+int usePeriods = 0;
+int minMonth = -1;
+int maxMonth = -1;
+long undatedEntries = 0;
+
+// Period given by --compare, both ranges are inclusive
+int compareOldFrom, compareOldTo, compareNewFrom, compareNewTo;
+char compareOldLabel[16], compareNewLabel[16];
+
+// Parsing errors are collected with a code and written to stderr in batches
+enum parseErrorCode
+{
+    PARSE_ERROR_MISSING_CATEGORY,
+    PARSE_ERROR_INVALID_AMOUNT,
+    PARSE_ERROR_AMOUNT_OUT_OF_RANGE,
+    PARSE_ERROR_CODES
+};
+const char *PARSE_ERROR_MESSAGES[PARSE_ERROR_CODES] = {
+    "missing category",
+    "invalid amount",
+    "amount out of range",
+};
+
+typedef struct parseError
+{
+    const char *input;
+    unsigned int lineno;
+    enum parseErrorCode code;
+} parseError;
+parseError parseErrors[PARSE_ERROR_BATCH];
+int pendingParseErrors = 0;
+long parseErrorCounts[PARSE_ERROR_CODES];
+long parseErrorTotal = 0;
+const char *currentInput = NULL;
+
+// Errors of a file written to the --diff cache, replayed when the cache is read
+parseError *recordedErrors = NULL;
+long recordedErrorCount = 0;
+long recordedErrorCapacity = 0;
+int recordingErrors = 0;
+
+// Input files found by --recursive, sorted by their month
+typedef struct inputFile
+{
+    char *path;
+    int month;
+} inputFile;
+inputFile *inputFiles = NULL;
+size_t inputFileCount = 0;
+size_t inputFileCapacity = 0;
+
+// Entries kept in memory by --interactive, all text columns point into a shared pool
+enum entryField
+{
+    FIELD_DAY,
+    FIELD_CATEGORY,
+    FIELD_COMMENT,
+    FIELD_MONTH,
+    FIELD_COUNT
+};
+const char *FIELD_NAMES[FIELD_COUNT] = { "day", "category", "comment", "month" };
+
+// A distinct text of the entries, stored once in a hash index.
+// Queries keep whether it passes the filter of its field and the bucket it is grouped into.
+typedef struct internedString
+{
+    struct internedString *nextInSlot;
+    unsigned long long hash;
+    int matches;
+    bucket *group;
+    char text[];
+} internedString;
+
+typedef struct stringPool
+{
+    internedString **slots;
+    size_t slotCount;
+    size_t count;
+} stringPool;
+
+typedef struct entry
+{
+    internedString *fields[FIELD_COUNT];
+    money cents;
+} entry;
+entry *entries = NULL;
+size_t entryCount = 0;
+size_t entryCapacity = 0;
+stringPool fieldStrings[FIELD_COUNT];
+
+// Months are formatted once, indexed from the first month seen
+internedString **monthStrings = NULL;
+int firstMonthString = 0;
+int monthStringCount = 0;
+internedString *undatedString = NULL;
+
+// Current query of --interactive
+enum sortMode
+{
+    SORT_NONE,
+    SORT_NAME,
+    SORT_AMOUNT
+};
+char *filters[FIELD_COUNT];
+enum entryField groupField = FIELD_CATEGORY;
+enum sortMode sortMode = SORT_NONE;
 
 // Track the positive and negative totals
-long positiveTotalCents = 0;
-long negativeTotalCents = 0;
+money positiveTotalCents = 0;
+money negativeTotalCents = 0;
+
+// Chart dimensions of the current report
+int chartwidth = 0;
+int totalwidth = 0;
 
 char *strdup (const char *s)
 {
@@ -79,95 +292,687 @@ char *strdup (const char *s)
         return NULL;
 }
 
-FILE* chooseInput(int argc, const char **argv)
+void exitDueToOverflow(void)
 {
-    FILE *input;
-    if (argc <= 0) {
-        input = stdin;
-    } else {
-        input = fopen(*argv, "r");
+    fprintf(stderr, "Unable to sum up the entries: totals exceed %d bits\n", (int)(sizeof(money) * CHAR_BIT));
+    exit(EXIT_FAILURE);
+}
 
-        if (NULL == input) {
-            fprintf(stderr, "Unable to open '%s': %s\n", *argv, strerror(errno));
-            exit(EXIT_FAILURE);
+// Checked arithmetic, overflows end the program instead of wrapping silently
+money addMoney(money a, money b)
+{
+    if ((b > 0 && a > MONEY_MAX - b) || (b < 0 && a < MONEY_MIN - b))
+        exitDueToOverflow();
+    return a + b;
+}
+
+money subMoney(money a, money b)
+{
+    if ((b < 0 && a > MONEY_MAX + b) || (b > 0 && a < MONEY_MIN + b))
+        exitDueToOverflow();
+    return a - b;
+}
+
+umoney magnitude(money value)
+{
+    return (value < 0 ? -(umoney)value : (umoney)value);
+}
+
+// Exact part * scale / whole without intermediate overflow, saturates if the result does not fit
+umoney scaleMoney(umoney part, umoney whole, unsigned int scale)
+{
+    umoney quotient = part / whole;
+    if (quotient > (umoney)MONEY_MAX / scale)
+        return MONEY_MAX;
+
+    // Long multiplication of the remainder, one bit of scale at a time
+    umoney remainder = part % whole;
+    umoney fraction = 0;
+    umoney rest = 0;
+    for (int bit = sizeof(scale) * CHAR_BIT - 1; bit >= 0; bit--) {
+        fraction <<= 1;
+        rest <<= 1;
+        if (rest >= whole) {
+            rest -= whole;
+            fraction++;
+        }
+        if ((scale >> bit) & 1) {
+            rest += remainder;
+            if (rest >= whole) {
+                rest -= whole;
+                fraction++;
+            }
         }
     }
+    return quotient * scale + fraction;
+}
+
+// Formats an integer with the given number of decimals, e.g. -123456 as -1234.56
+char* formatDecimal(char* buffer, money value, int decimals)
+{
+    char digits[MONEY_LENGTH];
+    umoney rest = magnitude(value);
+    int length = 0;
+    do {
+        digits[length++] = '0' + (int)(rest % 10);
+        rest /= 10;
+    } while (rest > 0 || length <= decimals);
+
+    char *c = buffer;
+    if (value < 0)
+        *c++ = '-';
+    while (length > 0) {
+        if (length == decimals)
+            *c++ = '.';
+        *c++ = digits[--length];
+    }
+    *c = '\0';
+    return buffer;
+}
+
+char* formatCents(char* buffer, money cents)
+{
+    return formatDecimal(buffer, cents, 2);
+}
+
+// Parses [whitespace][sign]digits, returns the amount of digits or -1 if the value does not fit
+int parseDigits(const char* text, const char** end, int* negative, money* value)
+{
+    int digits = 0;
+    *negative = 0;
+    *value = 0;
+
+    while (*text == ' ' || *text == '\t')
+        text++;
+    if (*text == '-' || *text == '+')
+        *negative = (*text++ == '-');
+    for (; *text >= '0' && *text <= '9'; text++, digits++) {
+        int digit = *text - '0';
+        if (*value > (MONEY_MAX - digit) / 10)
+            digits = -1;
+        if (digits >= 0)
+            *value = *value * 10 + digit;
+        else
+            digits--;
+    }
+    *end = text;
+    return (digits < 0 ? -1 : digits);
+}
+
+FILE* openInput(const char *path)
+{
+    FILE *input = fopen(path, "r");
+    if (NULL == input) {
+        fprintf(stderr, "Unable to open '%s': %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
     return input;
 }
 
-void addEntryToBucket(char* category, long cents)
+// Parses a month at the beginning of text, e.g. "2018-04", "2018/04", or "2018-04-21"
+int parseMonth(const char *text, const char **end)
 {
-    struct bucket* current = buckets;
-    // Try to add the money to an existing category
-    while (current != NULL) {
-        if (strcmp(category, current->category) == 0) {
-            current->totalCents = current->totalCents + cents;
-            return;
+    for (int i = 0; i < 7; i++) {
+        if (i == 4 ? strchr("-/\\", text[i]) == NULL || text[i] == '\0' : text[i] < '0' || text[i] > '9')
+            return -1;
+    }
+    if (text[7] >= '0' && text[7] <= '9')
+        return -1;
+
+    int year = atoi(text);
+    int month = atoi(text + 5);
+    if (month < 1 || month > 12)
+        return -1;
+    if (end != NULL)
+        *end = text + 7;
+    return year * 12 + month - 1;
+}
+
+// Finds the last month inside a path, e.g. "ledgers/2018/04.txt"
+int findMonth(const char *path)
+{
+    int month = -1;
+    for (const char *c = path; *c != '\0'; c++) {
+        if (c == path || c[-1] < '0' || c[-1] > '9') {
+            int found = parseMonth(c, NULL);
+            if (found >= 0)
+                month = found;
         }
+    }
+    return month;
+}
+
+// Parses a period of one month (2018-04) or one year (2018) for --compare
+int parsePeriod(const char *text, const char **end, int *from, int *to, char *label)
+{
+    int month = parseMonth(text, end);
+    if (month >= 0) {
+        *from = *to = month;
+    } else {
+        char *yearEnd;
+        long year = strtol(text, &yearEnd, 10);
+        if (yearEnd - text != 4)
+            return 0;
+        *end = yearEnd;
+        *from = year * 12;
+        *to = year * 12 + 11;
+    }
+    snprintf(label, 16, "%.*s", (int)(*end - text), text);
+    return 1;
+}
+
+void parseRolling(Argparser* self, const ArgparserOption* option)
+{
+    char *unit;
+    rollingMonths = strtol(rollingArg, &unit, 10);
+    if (*unit == 'y')
+        rollingMonths *= 12;
+    if (unit == rollingArg || rollingMonths <= 0 || (*unit != '\0' && strcmp(unit, "m") != 0 && strcmp(unit, "y") != 0))
+        Argparser_exitDueToError(self, option, "expects a window in months or years, e.g. 3m or 1y");
+    usePeriods = 1;
+}
+
+void parseCompare(Argparser* self, const ArgparserOption* option)
+{
+    const char *end;
+    if (!parsePeriod(compareArg, &end, &compareOldFrom, &compareOldTo, compareOldLabel) || *end != ','
+        || !parsePeriod(end + 1, &end, &compareNewFrom, &compareNewTo, compareNewLabel) || *end != '\0')
+        Argparser_exitDueToError(self, option, "expects two periods, e.g. 2018-01,2018-02 or 2017,2018");
+    usePeriods = 1;
+}
+
+void parseMemLimit(Argparser* self, const ArgparserOption* option)
+{
+    char *unit;
+    errno = 0;
+    unsigned long long limit = strtoull(memLimitArg, &unit, 10);
+    if (errno || unit == memLimitArg)
+        Argparser_exitDueToError(self, option, "expects a size, e.g. 512K, 64M, or 2G");
+
+    int shift = 0;
+    if (*unit == 'K' || *unit == 'k')
+        shift = 10;
+    else if (*unit == 'M' || *unit == 'm')
+        shift = 20;
+    else if (*unit == 'G' || *unit == 'g')
+        shift = 30;
+    if (shift > 0)
+        unit++;
+    if (*unit != '\0')
+        Argparser_exitDueToError(self, option, "expects a size, e.g. 512K, 64M, or 2G");
+    if (limit > (SIZE_MAX >> shift))
+        Argparser_exitDueToError(self, option, "is too large");
+    memLimit = (size_t)limit << shift;
+}
+
+FILE* createTempFile(void)
+{
+    FILE *file = tmpfile();
+    if (NULL == file) {
+        fprintf(stderr, "Unable to create temporary file: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return file;
+}
+
+// FNV-1a hash of a category name
+unsigned long long hashCategory(const char* category)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (const unsigned char* c = (const unsigned char*)category; *c != '\0'; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void growBucketTable(bucketTable* table)
+{
+    size_t slotCount = (table->slotCount > 0 ? table->slotCount * 2 : 64);
+    bucket **slots = calloc(slotCount, sizeof(bucket*));
+
+    // Rehash all buckets into the new slots
+    struct bucket* current = table->first;
+    while (current != NULL) {
+        size_t slot = current->hash & (slotCount - 1);
+        current->nextInSlot = slots[slot];
+        slots[slot] = current;
         current = current->nextBucket;
     }
 
-    // No existing entry found, create new one
+    free(table->slots);
+    table->bytes += (slotCount - table->slotCount) * sizeof(bucket*);
+    table->slots = slots;
+    table->slotCount = slotCount;
+}
+
+bucket* findBucket(const bucketTable* table, const char* category, unsigned long long hash)
+{
+    if (table->slotCount == 0)
+        return NULL;
+
+    struct bucket* current = table->slots[hash & (table->slotCount - 1)];
+    while (current != NULL) {
+        if (current->hash == hash && strcmp(category, current->category) == 0)
+            return current;
+        current = current->nextInSlot;
+    }
+    return NULL;
+}
+
+// Creates an empty bucket in front of all others
+bucket* createBucket(bucketTable* table, const char* category, unsigned long long hash)
+{
+    if (table->count >= table->slotCount)
+        growBucketTable(table);
+
+    size_t slot = hash & (table->slotCount - 1);
     struct bucket *newCategory = malloc(sizeof(struct bucket));
     newCategory->category = strdup(category);
-    newCategory->totalCents = cents;
-    newCategory->nextBucket = buckets;
-    buckets = newCategory;
+    newCategory->totalCents = 0;
+    newCategory->hash = hash;
+    newCategory->firstSeen = bucketSequence++;
+    newCategory->monthCents = NULL;
+    newCategory->firstMonth = 0;
+    newCategory->monthCount = 0;
+    newCategory->nextBucket = table->first;
+    newCategory->nextInSlot = table->slots[slot];
+    table->first = newCategory;
+    table->slots[slot] = newCategory;
+    table->count++;
+    table->bytes += sizeof(struct bucket) + strlen(category) + 1;
+    return newCategory;
+}
+
+void freeBucket(bucket* current)
+{
+    free(current->monthCents);
+    free(current->category);
+    free(current);
+}
+
+void clearBuckets(void)
+{
+    struct bucket* current = buckets.first;
+    while (current != NULL) {
+        struct bucket* next = current->nextBucket;
+        freeBucket(current);
+        current = next;
+    }
+    free(buckets.slots);
+    memset(&buckets, 0, sizeof(buckets));
+}
+
+// Adds cents to the monthly totals of a bucket, growing its range if necessary
+void addToMonth(bucket* current, int month, money cents)
+{
+    if (month < 0) {
+        undatedEntries++;
+        return;
+    }
+
+    if (current->monthCount == 0 || month < current->firstMonth || month >= current->firstMonth + current->monthCount) {
+        int first = (current->monthCount > 0 ? min(current->firstMonth, month) : month);
+        int count = (current->monthCount > 0 ? max(current->firstMonth + current->monthCount, month + 1) - first : 1);
+        money *monthCents = calloc(count, sizeof(money));
+        if (current->monthCount > 0)
+            memcpy(monthCents + current->firstMonth - first, current->monthCents, current->monthCount * sizeof(money));
+        free(current->monthCents);
+        current->monthCents = monthCents;
+        current->firstMonth = first;
+        current->monthCount = count;
+    }
+    current->monthCents[month - current->firstMonth] = addMoney(current->monthCents[month - current->firstMonth], cents);
+
+    minMonth = (minMonth < 0 ? month : min(minMonth, month));
+    maxMonth = max(maxMonth, month);
+}
+
+// Sorts by partition and category
+int compareSpillOrder(const void *a, const void *b)
+{
+    const bucket *x = *(const bucket**)a;
+    const bucket *y = *(const bucket**)b;
+    int partitionX = x->hash % SPILL_PARTITIONS;
+    int partitionY = y->hash % SPILL_PARTITIONS;
+    if (partitionX != partitionY)
+        return partitionX - partitionY;
+    return strcmp(x->category, y->category);
+}
+
+// Sorts by creation order, newest first
+int compareResultOrder(const void *a, const void *b)
+{
+    const bucket *x = *(const bucket**)a;
+    const bucket *y = *(const bucket**)b;
+    return (x->firstSeen < y->firstSeen) - (x->firstSeen > y->firstSeen);
+}
+
+void writeRecord(spillRun *run, int partition, long firstSeen, money totalCents, const char* category)
+{
+    char cents[MONEY_LENGTH];
+    fprintf(run->file, "%ld %s %s\n", firstSeen, formatDecimal(cents, totalCents, 0), category);
+    run->counts[partition]++;
+}
+
+void flushSpillRun(spillRun *run)
+{
+    if (fflush(run->file) != 0) {
+        fprintf(stderr, "Unable to write temporary file: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+void compactSpillRuns(spillRun **runs, int *runCount, int first, int partitioned);
+
+// Writes the given buckets as a new sorted run and frees them
+void writeSpillRun(spillRun **runs, int *runCount, bucket **sorted, size_t count, int partitioned)
+{
+    *runs = realloc(*runs, (*runCount + 1) * sizeof(spillRun));
+    spillRun *run = &(*runs)[(*runCount)++];
+    memset(run, 0, sizeof(spillRun));
+    run->file = createTempFile();
+
+    int partition = -1;
+    for (size_t i = 0; i < count; i++) {
+        int current = (partitioned ? sorted[i]->hash % SPILL_PARTITIONS : 0);
+        while (partition < current)
+            run->offsets[++partition] = ftell(run->file);
+        writeRecord(run, partition, sorted[i]->firstSeen, sorted[i]->totalCents, sorted[i]->category);
+        freeBucket(sorted[i]);
+    }
+    flushSpillRun(run);
+
+    // Merge SPILL_FAN_IN runs of the same level into one run of the next level,
+    // this limits open temporary files and every record is only rewritten once per level
+    while (*runCount >= SPILL_FAN_IN
+           && (*runs)[*runCount - SPILL_FAN_IN].level == (*runs)[*runCount - 1].level)
+        compactSpillRuns(runs, runCount, *runCount - SPILL_FAN_IN, partitioned);
+}
+
+// Moves all buckets into a sorted run on disk, the hash slots are kept for reuse
+void spillBuckets(void)
+{
+    bucket **sorted = malloc(buckets.count * sizeof(bucket*));
+    size_t count = 0;
+    struct bucket* current = buckets.first;
+    while (current != NULL) {
+        sorted[count++] = current;
+        current = current->nextBucket;
+    }
+    qsort(sorted, count, sizeof(bucket*), compareSpillOrder);
+    writeSpillRun(&spillRuns, &spillRunCount, sorted, count, 1);
+    free(sorted);
+
+    if (buckets.slotCount > 0)
+        memset(buckets.slots, 0, buckets.slotCount * sizeof(bucket*));
+    buckets.first = NULL;
+    buckets.count = 0;
+    buckets.bytes = buckets.slotCount * sizeof(bucket*);
+}
+
+void addEntryToBucket(const char* category, money cents, int month)
+{
+    unsigned long long hash = hashCategory(category);
+
+    // Try to add the money to an existing category, create a new one otherwise
+    struct bucket* current = findBucket(&buckets, category, hash);
+    int created = (current == NULL);
+    if (created)
+        current = createBucket(&buckets, category, hash);
+
+    current->totalCents = addMoney(current->totalCents, cents);
+    if (usePeriods)
+        addToMonth(current, month, cents);
+
+    // Runs hold a minimum of buckets, so tiny limits do not spill every new category
+    if (created && memLimit > 0 && buckets.bytes > memLimit && buckets.count >= SPILL_MIN_BUCKETS)
+        spillBuckets();
+}
+
+void growStringPool(stringPool* pool)
+{
+    size_t slotCount = (pool->slotCount > 0 ? pool->slotCount * 2 : 64);
+    internedString **slots = calloc(slotCount, sizeof(internedString*));
+
+    // Rehash all strings into the new slots
+    for (size_t i = 0; i < pool->slotCount; i++) {
+        internedString *current = pool->slots[i];
+        while (current != NULL) {
+            internedString *next = current->nextInSlot;
+            size_t slot = current->hash & (slotCount - 1);
+            current->nextInSlot = slots[slot];
+            slots[slot] = current;
+            current = next;
+        }
+    }
+
+    free(pool->slots);
+    pool->slots = slots;
+    pool->slotCount = slotCount;
+}
+
+internedString* internString(stringPool* pool, const char* text)
+{
+    unsigned long long hash = hashCategory(text);
+    if (pool->slotCount > 0) {
+        internedString *current = pool->slots[hash & (pool->slotCount - 1)];
+        while (current != NULL) {
+            if (current->hash == hash && strcmp(text, current->text) == 0)
+                return current;
+            current = current->nextInSlot;
+        }
+    }
+
+    if (pool->count >= pool->slotCount)
+        growStringPool(pool);
+    size_t slot = hash & (pool->slotCount - 1);
+    size_t length = strlen(text);
+    internedString *newString = malloc(sizeof(internedString) + length + 1);
+    memcpy(newString->text, text, length + 1);
+    newString->hash = hash;
+    newString->matches = 1;
+    newString->group = NULL;
+    newString->nextInSlot = pool->slots[slot];
+    pool->slots[slot] = newString;
+    pool->count++;
+    return newString;
+}
+
+internedString* internMonth(int month)
+{
+    if (month < 0) {
+        if (undatedString == NULL)
+            undatedString = internString(&fieldStrings[FIELD_MONTH], "-");
+        return undatedString;
+    }
+
+    if (monthStringCount == 0 || month < firstMonthString || month >= firstMonthString + monthStringCount) {
+        int first = (monthStringCount > 0 ? min(firstMonthString, month) : month);
+        int count = (monthStringCount > 0 ? max(firstMonthString + monthStringCount, month + 1) - first : 1);
+        internedString **strings = calloc(count, sizeof(internedString*));
+        if (monthStringCount > 0)
+            memcpy(strings + firstMonthString - first, monthStrings, monthStringCount * sizeof(internedString*));
+        free(monthStrings);
+        monthStrings = strings;
+        firstMonthString = first;
+        monthStringCount = count;
+    }
+
+    internedString **slot = &monthStrings[month - firstMonthString];
+    if (*slot == NULL) {
+        char monthText[16];
+        snprintf(monthText, sizeof(monthText), "%04d-%02d", month / 12, month % 12 + 1);
+        *slot = internString(&fieldStrings[FIELD_MONTH], monthText);
+    }
+    return *slot;
+}
+
+void recordEntry(const char* day, const char* category, const char* comment, money cents, int month)
+{
+    if (entryCount >= entryCapacity) {
+        entryCapacity = (entryCapacity > 0 ? entryCapacity * 2 : 1024);
+        entries = realloc(entries, entryCapacity * sizeof(entry));
+    }
+
+    entry *current = &entries[entryCount++];
+    current->fields[FIELD_DAY] = internString(&fieldStrings[FIELD_DAY], day);
+    current->fields[FIELD_CATEGORY] = internString(&fieldStrings[FIELD_CATEGORY], category);
+    current->fields[FIELD_COMMENT] = internString(&fieldStrings[FIELD_COMMENT], comment != NULL ? comment + strspn(comment, " \t") : "");
+    current->fields[FIELD_MONTH] = internMonth(month);
+    current->cents = cents;
+}
+
+// Writes all pending parsing errors with a single write to stderr
+void flushParseErrors(void)
+{
+    char text[8192];
+    size_t used = 0;
+    for (int i = 0; i < pendingParseErrors; i++) {
+        const parseError *error = &parseErrors[i];
+        char line[512];
+        int length;
+        if (error->input != NULL)
+            length = snprintf(line, sizeof(line), "WARNING: Entry ignored. Parsing error (%s) in line %u of %s.\n",
+                PARSE_ERROR_MESSAGES[error->code], error->lineno, error->input);
+        else
+            length = snprintf(line, sizeof(line), "WARNING: Entry ignored. Parsing error (%s) in line %u.\n",
+                PARSE_ERROR_MESSAGES[error->code], error->lineno);
+        length = min(length, (int)sizeof(line) - 1);
+
+        if (used + length > sizeof(text)) {
+            fwrite(text, 1, used, stderr);
+            used = 0;
+        }
+        memcpy(text + used, line, length);
+        used += length;
+    }
+    fwrite(text, 1, used, stderr);
+    pendingParseErrors = 0;
+}
+
+void recordParseError(unsigned int lineno, enum parseErrorCode code)
+{
+    if (recordedErrorCount >= recordedErrorCapacity) {
+        recordedErrorCapacity = (recordedErrorCapacity > 0 ? recordedErrorCapacity * 2 : 64);
+        recordedErrors = realloc(recordedErrors, recordedErrorCapacity * sizeof(parseError));
+    }
+    recordedErrors[recordedErrorCount++] = (parseError) { currentInput, lineno, code };
+}
+
+void reportParseError(unsigned int lineno, enum parseErrorCode code)
+{
+    if (recordingErrors)
+        recordParseError(lineno, code);
+    parseErrorCounts[code]++;
+    parseErrorTotal++;
+    if (parseErrorTotal > maxErrors)
+        return;
+
+    parseErrors[pendingParseErrors++] = (parseError) { currentInput, lineno, code };
+    if (pendingParseErrors == PARSE_ERROR_BATCH)
+        flushParseErrors();
+}
+
+// Prints the remaining errors and a summary of all codes
+void summarizeParseErrors(void)
+{
+    flushParseErrors();
+    if (parseErrorTotal == 0)
+        return;
+
+    fprintf(stderr, "WARNING: %ld entries ignored due to parsing errors (", parseErrorTotal);
+    const char *separator = "";
+    for (int code = 0; code < PARSE_ERROR_CODES; code++) {
+        if (parseErrorCounts[code] > 0) {
+            fprintf(stderr, "%s%ld %s", separator, parseErrorCounts[code], PARSE_ERROR_MESSAGES[code]);
+            separator = ", ";
+        }
+    }
+    fprintf(stderr, ").\n");
+    if (parseErrorTotal > maxErrors)
+        fprintf(stderr, "WARNING: %ld errors not shown, see --max-errors.\n", parseErrorTotal - max(maxErrors, 0));
 }
 
-void processEntry(unsigned int lineno, char* line)
+void processEntry(unsigned int lineno, char* line, int month)
 {
     char* day = strtok(line, SEPARATOR_CSV);
+    // Ignore empty lines
+    if (day == NULL)
+        return;
+
     char* category = strtok(NULL, SEPARATOR_CSV);
     char* euros = strtok(NULL, SEPARATOR_CURRENCY);
     char* cents = strtok(NULL, SEPARATOR_CSV);
 
     if(day != NULL && category != NULL && euros != NULL && cents != NULL) {
         // Concat cents and euros while respecting the sign
-        long total = atoi(euros) * 100;
-        if (total >= 0)
-            total += atoi(cents);
-        else
-            total -= atoi(cents);
+        const char *eurosEnd, *centsEnd;
+        int negative, negativeCents;
+        money total, centValue;
+        int euroDigits = parseDigits(euros, &eurosEnd, &negative, &total);
+        int centDigits = parseDigits(cents, &centsEnd, &negativeCents, &centValue);
+        if (euroDigits < 0 || centDigits < 0 || total > (MONEY_MAX - centValue) / 100) {
+            reportParseError(lineno, PARSE_ERROR_AMOUNT_OUT_OF_RANGE);
+            return;
+        }
+        if ((euroDigits == 0 && !negative) || centDigits != 2 || negativeCents || *eurosEnd != '\0' || *centsEnd != '\0') {
+            reportParseError(lineno, PARSE_ERROR_INVALID_AMOUNT);
+            return;
+        }
+        total = total * 100 + centValue;
+        if (negative)
+            total = -total;
 
         // Inverse entry if argument is given
         if(inverse)
             total = -total;
 
-        // Add the entry to a bucket
-        addEntryToBucket(category, total);
+        // Full dates in the day column override the month of the file
+        if (usePeriods || interactive) {
+            int dayMonth = parseMonth(day, NULL);
+            if (dayMonth >= 0)
+                month = dayMonth;
+        }
+
+        // Keep the whole entry for queries or add it to a bucket
+        if (interactive)
+            recordEntry(day, category, strtok(NULL, "\r\n"), total, month);
+        else
+            addEntryToBucket(category, total, month);
+    } else if (category == NULL) {
+        reportParseError(lineno, PARSE_ERROR_MISSING_CATEGORY);
     } else {
-        // Ignore empty lines, but show error otherwise
-        if(strspn(line, " \r\n\t") != strlen(line))
-            printf("WARNING: Entry ignored. Parsing error in line %d.\n", lineno);
+        reportParseError(lineno, PARSE_ERROR_INVALID_AMOUNT);
     }
 }
 
-// Calculate chartwidth
+// Fits the chart into the terminal of stdout, or uses the full size if it is not a terminal
 int calculateChartwidth()
 {
 #ifdef WIN32
     CONSOLE_SCREEN_BUFFER_INFO csbi;
-    GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
+    if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi))
+        return MAX_CHART_SIZE;
     int width = csbi.srWindow.Right - csbi.srWindow.Left + 1;
     return min(MAX_CHART_SIZE, width - CHART_OFFSET - 2);
 #else
-    struct winsize w;
-    ioctl(0, TIOCGWINSZ, &w);
+    struct winsize w = { 0 };
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) != 0 || w.ws_col == 0)
+        return MAX_CHART_SIZE;
     return min(MAX_CHART_SIZE, w.ws_col - CHART_OFFSET - 2);
 #endif
 }
 
 
 // Prints a chart if not deactivated
-void printChart(int chartWidth, float percentage, char* in, char out)
+void printChart(int chartWidth, umoney part, umoney whole, char* in, char out)
 {
-    float charStep = 100.0 / chartWidth;
-    percentage = min(100, percentage);
+    umoney filled = (whole > 0 && chartWidth > 0 ? scaleMoney(part, whole, chartWidth) : 0);
 
     printf("%s", CHART_BORDER_LEFT);
     for(int i=1; i <= chartWidth; i++) {
-        if(percentage >= charStep * i) {
+        if(filled >= (umoney)i) {
             printf("%s", in);
         } else {
             printf("%c", out);
@@ -176,12 +981,16 @@ void printChart(int chartWidth, float percentage, char* in, char out)
     printf("%s", CHART_BORDER_RIGHT);
 }
 
-void printChartOrPercent(int chartWidth, float percentage)
+// Shows part as a share of whole, both given in cents
+void printChartOrPercent(int chartWidth, money part, money whole)
 {
     if(nochart) {
-        printf("%8.2f", percentage);
+        // Hundredths of a percent, rounded half up
+        char percentage[MONEY_LENGTH];
+        umoney hundredths = (whole > 0 ? (scaleMoney(magnitude(part), whole, 20000) + 1) / 2 : 0);
+        printf("%8s", formatCents(percentage, hundredths));
     } else {
-        printChart(chartWidth, percentage, CHART_FILLER, ' ');
+        printChart(chartWidth, magnitude(part), magnitude(whole), CHART_FILLER, ' ');
     }
 }
 
@@ -192,43 +1001,51 @@ void printLine(int size)
     printf("\n");
 }
 
-void printBuckets(void)
+void printHeader(void)
 {
-    int chartwidth = calculateChartwidth();
-    int totalwidth = (nochart ? CHART_OFFSET + 8 : CHART_OFFSET + chartwidth + 2);
+    chartwidth = (fixedChartwidth > 0 ? fixedChartwidth : calculateChartwidth());
+    totalwidth = (nochart ? CHART_OFFSET + 8 : CHART_OFFSET + chartwidth + 2);
 
     if(!noheader) {
-        printf("%-15.15s %9s %8s\n", "CATEGORY", "EXPENSE", "PERCENT");
+        // Interactive reports are labelled by the grouped field
+        const char *name = (interactive ? FIELD_NAMES[groupField] : "category");
+        char label[16];
+        size_t i = 0;
+        for (; name[i] != '\0' && i + 1 < sizeof(label); i++)
+            label[i] = toupper((unsigned char)name[i]);
+        label[i] = '\0';
+        printf("%-15.15s %9s %8s\n", label, "EXPENSE", "PERCENT");
         printLine(totalwidth);
     }
+}
 
-    // Print all buckets
-    struct bucket* current = buckets;
-    while (current != NULL) {
-        // Select line color if not deactivated
-        if(colorOutput) {
-            if(current->totalCents > 0)
-                printf(ANSI_COLOR_GREEN);
-            if(current->totalCents < 0)
-                printf(ANSI_COLOR_RED);
-        }
-
-        printf("%-15.15s %9.2f ", current->category, current->totalCents / 100.0);
-        float percentage = abs((current->totalCents * 100.0) / positiveTotalCents);
-        printChartOrPercent(chartwidth, percentage);
-        printf("\n");
-        current = current->nextBucket;
+void printBucket(const char* category, money totalCents)
+{
+    // Select line color if not deactivated
+    if(colorOutput) {
+        if(totalCents > 0)
+            printf(ANSI_COLOR_GREEN);
+        if(totalCents < 0)
+            printf(ANSI_COLOR_RED);
     }
 
+    char cents[MONEY_LENGTH];
+    printf("%-15.15s %9s ", category, formatCents(cents, totalCents));
+    printChartOrPercent(chartwidth, totalCents, positiveTotalCents);
+    printf("\n");
+}
+
+void printTotal(void)
+{
     if(!nototal) {
         if(colorOutput)
             printf(ANSI_COLOR_RESET);
         printLine(totalwidth);
 
-        long total = positiveTotalCents + negativeTotalCents;
-        printf("%-15.15s %9.2f ", "TOTAL", total / 100.0);
-        float percentage = abs(negativeTotalCents * 100.0 / positiveTotalCents);
-        printChartOrPercent(chartwidth, percentage);
+        char cents[MONEY_LENGTH];
+        money total = addMoney(positiveTotalCents, negativeTotalCents);
+        printf("%-15.15s %9s ", "TOTAL", formatCents(cents, total));
+        printChartOrPercent(chartwidth, negativeTotalCents, positiveTotalCents);
         printf("\n");
     }
 
@@ -237,52 +1054,1120 @@ void printBuckets(void)
         printf(ANSI_COLOR_RESET);
 }
 
+void printBuckets(void)
+{
+    printHeader();
+
+    // Print all buckets
+    struct bucket* current = buckets.first;
+    while (current != NULL) {
+        printBucket(current->category, current->totalCents);
+        current = current->nextBucket;
+    }
+
+    printTotal();
+}
+
+void addToTotals(money cents)
+{
+    if(cents >= 0)
+        positiveTotalCents = addMoney(positiveTotalCents, cents);
+    else
+        negativeTotalCents = addMoney(negativeTotalCents, cents);
+}
+
 void calculateTotals()
 {
     positiveTotalCents = 0;
     negativeTotalCents = 0;
 
-    struct bucket* current = buckets;
+    struct bucket* current = buckets.first;
     while (current != NULL) {
-        if(current->totalCents >= 0)
-            positiveTotalCents += current->totalCents;
-        else
-            negativeTotalCents += current->totalCents;
+        addToTotals(current->totalCents);
         current = current->nextBucket;
     }
 }
 
-int main(int argc, const char **argv)
+// Opens a cursor on one partition of a spilled run
+void openCursor(spillCursor *cursor, const spillRun *run, int partition)
 {
-    // Parse arguments
-    Argparser* argparser = Argparser_new();
-    Argparser_init(argparser, (ArgparserOption[]) {
-        ARGPARSER_OPT_HELP(),
-        ARGPARSER_OPT_BOOL('c', "color", &colorOutput, "display with colors"),
-        ARGPARSER_OPT_BOOL('i', "inverse", &inverse, "inverse the sign of all input"),
-        ARGPARSER_OPT_BOOL(0, "nochart", &nochart, "hide the chart"),
-        ARGPARSER_OPT_BOOL(0, "noheader", &noheader, "hide the header"),
-        ARGPARSER_OPT_BOOL(0, "nototal", &nototal, "hide the total"),
-        ARGPARSER_OPT_END(),
-    });
-    Argparser_setUsage(argparser, "bud [--inverse] [--noheader] [--color] [--nochart] [--nototal] FILE\n");
-    Argparser_setDescription(argparser, "Bud is a simple budget manager based on plain text files.\nIf no input FILE is given, it reads from STDIN.\n");
-    argc = Argparser_parse(argparser, argc, argv);
-    Argparser_clear(argparser);
-    Argparser_delete(argparser);
+    cursor->file = run->file;
+    cursor->remaining = run->counts[partition];
+    if (fseek(cursor->file, run->offsets[partition], SEEK_SET) != 0) {
+        fprintf(stderr, "Unable to read temporary file: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Reads one record into the cursor, returns 0 if the line is missing or malformed
+int readRecord(spillCursor *cursor)
+{
+    if (!fgets(cursor->line, SPILL_LINESIZE, cursor->file))
+        return 0;
+    size_t length = strlen(cursor->line);
+    if (length == 0 || cursor->line[length - 1] != '\n')
+        return 0;
+    cursor->line[length - 1] = '\0';
+
+    char *end;
+    const char *centsEnd;
+    int negative;
+    cursor->firstSeen = strtol(cursor->line, &end, 10);
+    if (end == cursor->line || parseDigits(end, &centsEnd, &negative, &cursor->cents) <= 0
+        || *centsEnd != ' ' || centsEnd[1] == '\0')
+        return 0;
+    if (negative)
+        cursor->cents = -cursor->cents;
+    cursor->category = (char*)centsEnd + 1;
+    return 1;
+}
+
+// Reads the next record, returns 0 if the partition is exhausted
+int advanceCursor(spillCursor *cursor)
+{
+    if (cursor->remaining <= 0)
+        return 0;
+    cursor->remaining--;
+
+    if (!readRecord(cursor)) {
+        fprintf(stderr, "Unable to read temporary file: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return 1;
+}
+
+// Restores the heap property below the given position of a heap of cursor indices
+void siftDown(int *heap, int size, int position, spillCursor *cursors, spillOrder *order)
+{
+    while (1) {
+        int smallest = position;
+        int left = 2 * position + 1;
+        int right = left + 1;
+        if (left < size && order(&cursors[heap[left]], &cursors[heap[smallest]]) < 0)
+            smallest = left;
+        if (right < size && order(&cursors[heap[right]], &cursors[heap[smallest]]) < 0)
+            smallest = right;
+        if (smallest == position)
+            return;
+        int swap = heap[position];
+        heap[position] = heap[smallest];
+        heap[smallest] = swap;
+        position = smallest;
+    }
+}
+
+// K-way merge of sorted cursors, emits all records in the given order
+void mergeCursors(spillCursor *cursors, int count, spillOrder *order, spillEmit *emit)
+{
+    int *heap = malloc(count * sizeof(int));
+    int size = 0;
+    for (int i = 0; i < count; i++) {
+        if (advanceCursor(&cursors[i]))
+            heap[size++] = i;
+    }
+    for (int i = size / 2 - 1; i >= 0; i--)
+        siftDown(heap, size, i, cursors, order);
+
+    while (size > 0) {
+        emit(&cursors[heap[0]]);
+        if (!advanceCursor(&cursors[heap[0]]))
+            heap[0] = heap[--size];
+        siftDown(heap, size, 0, cursors, order);
+    }
+    free(heap);
+}
+
+int compareCursorCategory(const spillCursor *a, const spillCursor *b)
+{
+    return strcmp(a->category, b->category);
+}
+
+int compareCursorOrder(const spillCursor *a, const spillCursor *b)
+{
+    return (a->firstSeen < b->firstSeen) - (a->firstSeen > b->firstSeen);
+}
+
+// Collects a fully merged bucket, spills them in output order if memory runs out
+void addResult(const char* category, money totalCents, long firstSeen)
+{
+    addToTotals(totalCents);
+
+    if (resultCount >= resultCapacity) {
+        resultCapacity = (resultCapacity > 0 ? resultCapacity * 2 : 64);
+        results = realloc(results, resultCapacity * sizeof(bucket*));
+    }
+    struct bucket *result = malloc(sizeof(struct bucket));
+    result->category = strdup(category);
+    result->totalCents = totalCents;
+    result->firstSeen = firstSeen;
+    result->monthCents = NULL;
+    results[resultCount++] = result;
+    resultBytes += sizeof(struct bucket) + sizeof(bucket*) + strlen(category) + 1;
+
+    if (memLimit > 0 && resultBytes > memLimit && resultCount >= SPILL_MIN_BUCKETS) {
+        qsort(results, resultCount, sizeof(bucket*), compareResultOrder);
+        writeSpillRun(&resultRuns, &resultRunCount, results, resultCount, 0);
+        resultCount = 0;
+        resultBytes = 0;
+    }
+}
 
-    // Choose if reading from file or stdin
-    FILE *input = chooseInput(argc, argv);
+// Combines consecutive records of the same category
+spillCursor pending;
+int hasPending = 0;
 
+void flushPending(void)
+{
+    if (!hasPending)
+        return;
+    hasPending = 0;
+    if (mergeTarget != NULL)
+        writeRecord(mergeTarget, mergePartition, pending.firstSeen, pending.cents, pending.category);
+    else
+        addResult(pending.category, pending.cents, pending.firstSeen);
+}
+
+void emitMergedCategory(const spillCursor *cursor)
+{
+    if (hasPending && strcmp(pending.category, cursor->category) == 0) {
+        pending.cents = addMoney(pending.cents, cursor->cents);
+        pending.firstSeen = min(pending.firstSeen, cursor->firstSeen);
+        return;
+    }
+
+    flushPending();
+    strcpy(pending.line, cursor->category);
+    pending.category = pending.line;
+    pending.cents = cursor->cents;
+    pending.firstSeen = cursor->firstSeen;
+    hasPending = 1;
+}
+
+void emitToTarget(const spillCursor *cursor)
+{
+    writeRecord(mergeTarget, mergePartition, cursor->firstSeen, cursor->cents, cursor->category);
+}
+
+void emitResult(const spillCursor *cursor)
+{
+    printBucket(cursor->category, cursor->cents);
+}
+
+void closeSpillRuns(spillRun *runs, int runCount)
+{
+    for (int i = 0; i < runCount; i++)
+        fclose(runs[i].file);
+}
+
+// Merges all runs from first on into a single one, categories are combined if the runs are partitioned
+void compactSpillRuns(spillRun **runs, int *runCount, int first, int partitioned)
+{
+    spillRun merged;
+    memset(&merged, 0, sizeof(merged));
+    merged.file = createTempFile();
+    merged.level = (*runs)[first].level + 1;
+    int count = *runCount - first;
+
+    // Result runs are compacted from within the final merge, restore its target afterwards
+    spillRun *previousTarget = mergeTarget;
+    int previousPartition = mergePartition;
+    mergeTarget = &merged;
+
+    spillCursor *cursors = malloc(count * sizeof(spillCursor));
+    for (int partition = 0; partition < (partitioned ? SPILL_PARTITIONS : 1); partition++) {
+        mergePartition = partition;
+        merged.offsets[partition] = ftell(merged.file);
+        for (int i = 0; i < count; i++)
+            openCursor(&cursors[i], &(*runs)[first + i], partition);
+        if (partitioned) {
+            mergeCursors(cursors, count, compareCursorCategory, emitMergedCategory);
+            flushPending();
+        } else {
+            mergeCursors(cursors, count, compareCursorOrder, emitToTarget);
+        }
+    }
+    free(cursors);
+    flushSpillRun(&merged);
+
+    mergeTarget = previousTarget;
+    mergePartition = previousPartition;
+    closeSpillRuns(*runs + first, count);
+    (*runs)[first] = merged;
+    *runCount = first + 1;
+}
+
+// Merges all spilled runs partition by partition
+void mergeSpillRuns(void)
+{
+    positiveTotalCents = 0;
+    negativeTotalCents = 0;
+
+    spillCursor *cursors = malloc(spillRunCount * sizeof(spillCursor));
+    for (int partition = 0; partition < SPILL_PARTITIONS; partition++) {
+        for (int i = 0; i < spillRunCount; i++)
+            openCursor(&cursors[i], &spillRuns[i], partition);
+        mergeCursors(cursors, spillRunCount, compareCursorCategory, emitMergedCategory);
+        flushPending();
+    }
+    free(cursors);
+
+    closeSpillRuns(spillRuns, spillRunCount);
+    free(spillRuns);
+    spillRuns = NULL;
+    spillRunCount = 0;
+}
+
+// Prints the merged buckets in the same order as the in-memory path
+void printSpilledBuckets(void)
+{
+    qsort(results, resultCount, sizeof(bucket*), compareResultOrder);
+    printHeader();
+
+    if (resultRunCount == 0) {
+        for (size_t i = 0; i < resultCount; i++)
+            printBucket(results[i]->category, results[i]->totalCents);
+    } else {
+        writeSpillRun(&resultRuns, &resultRunCount, results, resultCount, 0);
+        resultCount = 0;
+
+        spillCursor *cursors = malloc(resultRunCount * sizeof(spillCursor));
+        for (int i = 0; i < resultRunCount; i++)
+            openCursor(&cursors[i], &resultRuns[i], 0);
+        mergeCursors(cursors, resultRunCount, compareCursorOrder, emitResult);
+        free(cursors);
+    }
+
+    printTotal();
+}
+
+// Replaces the monthly totals of all buckets by prefix sums over [minMonth, maxMonth]
+void buildPrefixSums(void)
+{
+    int count = (minMonth < 0 ? 0 : maxMonth - minMonth + 1);
+
+    struct bucket* current = buckets.first;
+    while (current != NULL) {
+        money *prefix = calloc(count + 1, sizeof(money));
+        for (int i = 0; i < count; i++) {
+            int month = minMonth + i;
+            money cents = 0;
+            if (month >= current->firstMonth && month < current->firstMonth + current->monthCount)
+                cents = current->monthCents[month - current->firstMonth];
+            prefix[i + 1] = addMoney(prefix[i], cents);
+        }
+        free(current->monthCents);
+        current->monthCents = prefix;
+        current->firstMonth = minMonth;
+        current->monthCount = count;
+        current = current->nextBucket;
+    }
+}
+
+// Sum of a bucket over the inclusive month range, requires buildPrefixSums()
+money sumMonths(const bucket* current, int from, int to)
+{
+    from = max(from, current->firstMonth);
+    to = min(to, current->firstMonth + current->monthCount - 1);
+    if (from > to)
+        return 0;
+    return subMoney(current->monthCents[to - current->firstMonth + 1], current->monthCents[from - current->firstMonth]);
+}
+
+// Rounds half away from zero
+money averageCents(money cents, int months)
+{
+    money average = cents / months;
+    if (2 * magnitude(cents % months) >= (umoney)months)
+        average += (cents >= 0 ? 1 : -1);
+    return average;
+}
+
+void printRolling(void)
+{
+    for (int month = minMonth; month >= 0 && month <= maxMonth; month++) {
+        int from = max(minMonth, month - rollingMonths + 1);
+        int months = month - from + 1;
+
+        positiveTotalCents = 0;
+        negativeTotalCents = 0;
+        struct bucket* current = buckets.first;
+        while (current != NULL) {
+            addToTotals(averageCents(sumMonths(current, from, month), months));
+            current = current->nextBucket;
+        }
+
+        if (month > minMonth)
+            printf("\n");
+        printf("%04d-%02d (%d month average)\n", month / 12, month % 12 + 1, months);
+        printHeader();
+        current = buckets.first;
+        while (current != NULL) {
+            printBucket(current->category, averageCents(sumMonths(current, from, month), months));
+            current = current->nextBucket;
+        }
+        printTotal();
+    }
+}
+
+void printComparisonHeader(const char* oldLabel, const char* newLabel)
+{
+    if(!noheader) {
+        printf("%-15.15s %9.9s %9.9s %9s\n", "CATEGORY", oldLabel, newLabel, "DELTA");
+        printLine(COMPARISON_WIDTH);
+    }
+}
+
+// Prints old and new totals with their difference, note is optional
+void printComparisonLine(const char* category, money oldCents, money newCents, const char* note)
+{
+    money delta = subMoney(newCents, oldCents);
+    if(colorOutput) {
+        if(delta > 0)
+            printf(ANSI_COLOR_GREEN);
+        if(delta < 0)
+            printf(ANSI_COLOR_RED);
+    }
+    char oldText[MONEY_LENGTH], newText[MONEY_LENGTH], deltaText[MONEY_LENGTH + 1] = "+";
+    formatCents(deltaText + (delta >= 0), delta);
+    printf("%-15.15s %9s %9s %9s", category, formatCents(oldText, oldCents), formatCents(newText, newCents), deltaText);
+    if (note != NULL)
+        printf(" %s", note);
+    printf("\n");
+    if(colorOutput)
+        printf(ANSI_COLOR_RESET);
+}
+
+void printComparison(void)
+{
+    printComparisonHeader(compareOldLabel, compareNewLabel);
+
+    money oldTotal = 0;
+    money newTotal = 0;
+    struct bucket* current = buckets.first;
+    while (current != NULL) {
+        money oldCents = sumMonths(current, compareOldFrom, compareOldTo);
+        money newCents = sumMonths(current, compareNewFrom, compareNewTo);
+        if (oldCents != 0 || newCents != 0)
+            printComparisonLine(current->category, oldCents, newCents, NULL);
+        oldTotal = addMoney(oldTotal, oldCents);
+        newTotal = addMoney(newTotal, newCents);
+        current = current->nextBucket;
+    }
+
+    if(!nototal) {
+        printLine(COMPARISON_WIDTH);
+        printComparisonLine("TOTAL", oldTotal, newTotal, NULL);
+    }
+}
+
+void processInput(FILE* input, int month)
+{
     // Process all lines of the file
     unsigned int lineno = 1;
     char buffer[BUFFERSIZE];
     while (fgets(buffer, BUFFERSIZE, input)) {
-        processEntry(lineno, buffer);
+        processEntry(lineno, buffer, month);
         lineno++;
     }
+}
+
+// Joins two path components, "." as directory is omitted
+char* joinPath(const char* directory, const char* name)
+{
+    if (strcmp(directory, ".") == 0)
+        return strdup(name);
+    char *path = malloc(strlen(directory) + strlen(name) + 2);
+    sprintf(path, "%s/%s", directory, name);
+    return path;
+}
+
+void addInputFile(char* path)
+{
+    if (inputFileCount >= inputFileCapacity) {
+        inputFileCapacity = (inputFileCapacity > 0 ? inputFileCapacity * 2 : 64);
+        inputFiles = realloc(inputFiles, inputFileCapacity * sizeof(inputFile));
+    }
+    inputFiles[inputFileCount++] = (inputFile) { path, findMonth(path) };
+}
+
+// Files without month first, then by month and path
+int compareInputFiles(const void *a, const void *b)
+{
+    const inputFile *x = a;
+    const inputFile *y = b;
+    if (x->month != y->month)
+        return (x->month > y->month) - (x->month < y->month);
+    return strcmp(x->path, y->path);
+}
+
+#ifndef _WIN32
+// Directories waiting to be scanned, shared by all walking threads
+typedef struct directoryWalk
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int rootFd;
+    char **pending;     // Relative to rootFd
+    size_t pendingCount;
+    size_t pendingCapacity;
+    int active;         // Threads currently scanning a directory
+} directoryWalk;
+
+void pushDirectory(directoryWalk *walk, char* directory)
+{
+    if (walk->pendingCount >= walk->pendingCapacity) {
+        walk->pendingCapacity = (walk->pendingCapacity > 0 ? walk->pendingCapacity * 2 : 64);
+        walk->pending = realloc(walk->pending, walk->pendingCapacity * sizeof(char*));
+    }
+    walk->pending[walk->pendingCount++] = directory;
+}
+
+// Reads one directory and publishes its subdirectories and matching files at once
+void scanDirectory(directoryWalk *walk, const char* directory)
+{
+    int fd = openat(walk->rootFd, directory, O_RDONLY | O_DIRECTORY);
+    DIR *dir = (fd >= 0 ? fdopendir(fd) : NULL);
+    if (NULL == dir) {
+        fprintf(stderr, "Unable to open '%s/%s': %s\n", recursiveDir, directory, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    char **directories = NULL;
+    size_t directoryCount = 0, directoryCapacity = 0;
+    char **files = NULL;
+    size_t fileCount = 0, fileCapacity = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Skip ".", "..", and hidden entries such as .git
+        if (entry->d_name[0] == '.')
+            continue;
+
+        int type = entry->d_type;
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+            // Symbolic links are only followed to files to avoid cycles
+            struct stat status;
+            int isLink = (type == DT_LNK);
+            type = DT_UNKNOWN;
+            if (fstatat(fd, entry->d_name, &status, isLink ? 0 : AT_SYMLINK_NOFOLLOW) == 0) {
+                if (S_ISREG(status.st_mode))
+                    type = DT_REG;
+                else if (S_ISDIR(status.st_mode) && !isLink)
+                    type = DT_DIR;
+            }
+        }
+
+        if (type == DT_DIR) {
+            if (directoryCount >= directoryCapacity) {
+                directoryCapacity = (directoryCapacity > 0 ? directoryCapacity * 2 : 16);
+                directories = realloc(directories, directoryCapacity * sizeof(char*));
+            }
+            directories[directoryCount++] = joinPath(directory, entry->d_name);
+        } else if (type == DT_REG && fnmatch(fileGlob, entry->d_name, 0) == 0) {
+            char *relative = joinPath(directory, entry->d_name);
+            if (fileCount >= fileCapacity) {
+                fileCapacity = (fileCapacity > 0 ? fileCapacity * 2 : 64);
+                files = realloc(files, fileCapacity * sizeof(char*));
+            }
+            files[fileCount++] = joinPath(recursiveDir, relative);
+            free(relative);
+        }
+    }
+    closedir(dir);
+
+    pthread_mutex_lock(&walk->lock);
+    for (size_t i = 0; i < directoryCount; i++)
+        pushDirectory(walk, directories[i]);
+    for (size_t i = 0; i < fileCount; i++)
+        addInputFile(files[i]);
+    if (directoryCount > 0)
+        pthread_cond_broadcast(&walk->changed);
+    pthread_mutex_unlock(&walk->lock);
+
+    free(directories);
+    free(files);
+}
+
+void* walkDirectories(void* argument)
+{
+    directoryWalk *walk = argument;
+
+    pthread_mutex_lock(&walk->lock);
+    while (1) {
+        // The walk is finished if nothing is pending and nobody can add more
+        while (walk->pendingCount == 0 && walk->active > 0)
+            pthread_cond_wait(&walk->changed, &walk->lock);
+        if (walk->pendingCount == 0)
+            break;
+
+        char *directory = walk->pending[--walk->pendingCount];
+        walk->active++;
+        pthread_mutex_unlock(&walk->lock);
+
+        scanDirectory(walk, directory);
+        free(directory);
+
+        pthread_mutex_lock(&walk->lock);
+        walk->active--;
+        if (walk->active == 0)
+            pthread_cond_broadcast(&walk->changed);
+    }
+    pthread_mutex_unlock(&walk->lock);
+    return NULL;
+}
+#endif
+
+// Collects all files below recursiveDir that match fileGlob
+void collectInputFiles(void)
+{
+#ifdef _WIN32
+    fprintf(stderr, "--recursive is not supported on Windows\n");
+    exit(EXIT_FAILURE);
+#else
+    directoryWalk walk;
+    memset(&walk, 0, sizeof(walk));
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.changed, NULL);
+    walk.rootFd = open(recursiveDir, O_RDONLY | O_DIRECTORY);
+    if (walk.rootFd < 0) {
+        fprintf(stderr, "Unable to open '%s': %s\n", recursiveDir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    pushDirectory(&walk, strdup("."));
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    int threadCount = (int)max(1, min(MAX_WALK_THREADS, processors));
+    pthread_t threads[MAX_WALK_THREADS];
+    int started = 0;
+    for (int i = 0; i < threadCount; i++) {
+        if (pthread_create(&threads[started], NULL, walkDirectories, &walk) == 0)
+            started++;
+    }
+    // Without any thread, the calling thread walks the whole tree
+    if (started == 0)
+        walkDirectories(&walk);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    close(walk.rootFd);
+    free(walk.pending);
+    pthread_cond_destroy(&walk.changed);
+    pthread_mutex_destroy(&walk.lock);
+#endif
+
+    // Threads finish in any order, sorting makes the output deterministic
+    qsort(inputFiles, inputFileCount, sizeof(inputFile), compareInputFiles);
+}
+
+// Sub-second timestamps tell apart edits within the same second
+#if defined(__APPLE__)
+#define MTIME_NSEC(status) ((long)(status).st_mtimespec.tv_nsec)
+#define CTIME_NSEC(status) ((long)(status).st_ctimespec.tv_nsec)
+#elif defined(_WIN32)
+#define MTIME_NSEC(status) 0L
+#define CTIME_NSEC(status) 0L
+#else
+#define MTIME_NSEC(status) ((long)(status).st_mtim.tv_nsec)
+#define CTIME_NSEC(status) ((long)(status).st_ctim.tv_nsec)
+#endif
+
+// Identifies the state of a file for the cache, empty if it cannot be cached.
+// The change time is included since restoring the modification time does not reset it.
+void cacheKey(const char* path, char* key, size_t size)
+{
+    struct stat status;
+    key[0] = '\0';
+    if (stat(path, &status) != 0 || !S_ISREG(status.st_mode))
+        return;
+    snprintf(key, size, "bud-cache 3 %llu %llu %lld %lld.%09ld %lld.%09ld %d\n",
+        (unsigned long long)status.st_dev, (unsigned long long)status.st_ino, (long long)status.st_size,
+        (long long)status.st_mtime, MTIME_NSEC(status), (long long)status.st_ctime, CTIME_NSEC(status), inverse);
+}
+
+// Names the cache entry after the resolved path, so a changed file replaces its own entry.
+// The path is used instead of the inode, which is 0 on Windows and changes when git rewrites a file.
+char* cacheFilePath(const char* path)
+{
+    char *resolved = realpath(path, NULL);
+    if (NULL == resolved)
+        return NULL;
+
+    char *identity = malloc(strlen(resolved) + 16);
+    sprintf(identity, "%s %d", resolved, inverse);
+    char *cachePath = malloc(strlen(cacheDir) + 32);
+    sprintf(cachePath, "%s/%016llx.cache", cacheDir, hashCategory(identity));
+    free(identity);
+    free(resolved);
+    return cachePath;
+}
+
+// Replaces the buckets by the cached aggregate and reports the file's parse errors again.
+// Returns 0 on a cache miss, including a truncated or corrupt cache, leaving the buckets empty.
+int readCache(const char* cachePath, const char* key)
+{
+    FILE *cache = fopen(cachePath, "r");
+    if (NULL == cache)
+        return 0;
+
+    spillCursor cursor;
+    cursor.file = cache;
+    long count = -1, errors = -1;
+    char *end;
+    int hit = (fgets(cursor.line, SPILL_LINESIZE, cache) && strcmp(cursor.line, key) == 0
+        && fgets(cursor.line, SPILL_LINESIZE, cache) && sscanf(cursor.line, "%ld %ld", &count, &errors) == 2
+        && count >= 0 && errors >= 0);
+
+    // The errors are only reported once the whole cache is known to be valid
+    recordedErrorCount = 0;
+    for (long i = 0; hit && i < errors; i++) {
+        hit = (fgets(cursor.line, SPILL_LINESIZE, cache) != NULL);
+        unsigned long lineno = (hit ? strtoul(cursor.line, &end, 10) : 0);
+        long code = (hit && end != cursor.line ? strtol(end, &end, 10) : -1);
+        hit = (code >= 0 && code < PARSE_ERROR_CODES && *end == '\n');
+        if (hit)
+            recordParseError((unsigned int)lineno, (enum parseErrorCode)code);
+    }
+    for (long i = 0; hit && i < count; i++) {
+        hit = readRecord(&cursor);
+        if (hit)
+            addEntryToBucket(cursor.category, cursor.cents, -1);
+    }
+    hit = (hit && fgetc(cache) == EOF && !ferror(cache));
+    fclose(cache);
+
+    if (!hit) {
+        clearBuckets();
+        return 0;
+    }
+    for (long i = 0; i < recordedErrorCount; i++)
+        reportParseError(recordedErrors[i].lineno, recordedErrors[i].code);
+    return 1;
+}
+
+// Stores the recorded parse errors and the buckets oldest first, so reading them again restores their order
+void writeCache(const char* cachePath, const char* key)
+{
+    char *temporaryPath = malloc(strlen(cachePath) + 5);
+    sprintf(temporaryPath, "%s.tmp", cachePath);
+    FILE *cache = fopen(temporaryPath, "w");
+    if (NULL == cache) {
+        fprintf(stderr, "WARNING: Unable to write cache '%s': %s\n", temporaryPath, strerror(errno));
+        free(temporaryPath);
+        return;
+    }
+
+    bucket **ordered = malloc(buckets.count * sizeof(bucket*));
+    size_t count = buckets.count;
+    struct bucket* current = buckets.first;
+    while (current != NULL) {
+        ordered[--count] = current;
+        current = current->nextBucket;
+    }
+
+    fprintf(cache, "%s%ld %ld\n", key, (long)buckets.count, recordedErrorCount);
+    for (long i = 0; i < recordedErrorCount; i++)
+        fprintf(cache, "%u %d\n", recordedErrors[i].lineno, (int)recordedErrors[i].code);
+    for (size_t i = 0; i < buckets.count; i++) {
+        char cents[MONEY_LENGTH];
+        fprintf(cache, "%ld %s %s\n", ordered[i]->firstSeen, formatDecimal(cents, ordered[i]->totalCents, 0), ordered[i]->category);
+    }
+    free(ordered);
+
+    if (fclose(cache) != 0 || rename(temporaryPath, cachePath) != 0) {
+        fprintf(stderr, "WARNING: Unable to write cache '%s': %s\n", cachePath, strerror(errno));
+        remove(temporaryPath);
+    }
+    free(temporaryPath);
+}
+
+// Aggregates one side of --diff into its own table, reusing the cache if the file is unchanged
+bucketTable loadLedger(const char* path)
+{
+    memset(&buckets, 0, sizeof(buckets));
+
+    char key[SPILL_LINESIZE];
+    char *cachePath = NULL;
+    if (cacheDir != NULL) {
+        cacheKey(path, key, sizeof(key));
+        if (key[0] != '\0')
+            cachePath = cacheFilePath(path);
+    }
+
+    // Each table counts its own order, so a cache does not depend on the other side
+    currentInput = path;
+    bucketSequence = 0;
+    if (cachePath == NULL || !readCache(cachePath, key)) {
+        bucketSequence = 0;
+        FILE *input = openInput(path);
+        recordedErrorCount = 0;
+        recordingErrors = (cachePath != NULL);
+        processInput(input, -1);
+        recordingErrors = 0;
+        fclose(input);
+        if (cachePath != NULL)
+            writeCache(cachePath, key);
+    }
+    free(cachePath);
+
+    bucketTable table = buckets;
+    memset(&buckets, 0, sizeof(buckets));
+    return table;
+}
+
+int compareBucketCategory(const void *a, const void *b)
+{
+    return strcmp((*(const bucket**)a)->category, (*(const bucket**)b)->category);
+}
+
+bucket** sortBucketsByCategory(const bucketTable* table)
+{
+    bucket **sorted = malloc(table->count * sizeof(bucket*));
+    size_t count = 0;
+    struct bucket* current = table->first;
+    while (current != NULL) {
+        sorted[count++] = current;
+        current = current->nextBucket;
+    }
+    qsort(sorted, count, sizeof(bucket*), compareBucketCategory);
+    return sorted;
+}
+
+// Merge-join of both sides by category, prints changed, added, and removed categories
+void printDiff(const bucketTable* oldTable, const bucketTable* newTable)
+{
+    bucket **oldSorted = sortBucketsByCategory(oldTable);
+    bucket **newSorted = sortBucketsByCategory(newTable);
+    printComparisonHeader("OLD", "NEW");
+
+    money oldTotal = 0;
+    money newTotal = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < oldTable->count || j < newTable->count) {
+        int order;
+        if (i < oldTable->count && j < newTable->count)
+            order = strcmp(oldSorted[i]->category, newSorted[j]->category);
+        else
+            order = (i < oldTable->count ? -1 : 1);
+
+        if (order < 0) {
+            printComparisonLine(oldSorted[i]->category, oldSorted[i]->totalCents, 0, "removed");
+            oldTotal = addMoney(oldTotal, oldSorted[i++]->totalCents);
+        } else if (order > 0) {
+            printComparisonLine(newSorted[j]->category, 0, newSorted[j]->totalCents, "added");
+            newTotal = addMoney(newTotal, newSorted[j++]->totalCents);
+        } else {
+            if (oldSorted[i]->totalCents != newSorted[j]->totalCents)
+                printComparisonLine(newSorted[j]->category, oldSorted[i]->totalCents, newSorted[j]->totalCents, NULL);
+            oldTotal = addMoney(oldTotal, oldSorted[i++]->totalCents);
+            newTotal = addMoney(newTotal, newSorted[j++]->totalCents);
+        }
+    }
+
+    if(!nototal) {
+        printLine(COMPARISON_WIDTH);
+        printComparisonLine("TOTAL", oldTotal, newTotal, NULL);
+    }
+    free(oldSorted);
+    free(newSorted);
+}
+
+// Highest income first, highest expense last
+int compareBucketAmount(const void *a, const void *b)
+{
+    money x = (*(const bucket**)a)->totalCents;
+    money y = (*(const bucket**)b)->totalCents;
+    return (x < y) - (x > y);
+}
+
+// Relinks the buckets in the order of the given comparison
+void sortBuckets(int (*compare)(const void*, const void*))
+{
+    if (buckets.count == 0)
+        return;
+    bucket **sorted = malloc(buckets.count * sizeof(bucket*));
+    size_t count = 0;
+    struct bucket* current = buckets.first;
+    while (current != NULL) {
+        sorted[count++] = current;
+        current = current->nextBucket;
+    }
+    qsort(sorted, count, sizeof(bucket*), compare);
+    for (size_t i = 0; i + 1 < buckets.count; i++)
+        sorted[i]->nextBucket = sorted[i + 1];
+    sorted[buckets.count - 1]->nextBucket = NULL;
+    buckets.first = sorted[0];
+    free(sorted);
+}
+
+// Evaluates the filter of a field once for each of its distinct texts
+void applyFilter(int field)
+{
+    stringPool *pool = &fieldStrings[field];
+    for (size_t i = 0; i < pool->slotCount; i++) {
+        for (internedString *current = pool->slots[i]; current != NULL; current = current->nextInSlot)
+            current->matches = (filters[field] == NULL || strstr(current->text, filters[field]) != NULL);
+    }
+}
+
+int matchesFilters(const entry* current, const int* filtered, int filterCount)
+{
+    for (int i = 0; i < filterCount; i++) {
+        if (!current->fields[filtered[i]]->matches)
+            return 0;
+    }
+    return 1;
+}
+
+// Aggregates the resident entries for the current query and prints them as a report.
+// Rows only check the flags of their texts and add to the bucket linked from the grouped text.
+void printQuery(void)
+{
+    int filtered[FIELD_COUNT];
+    int filterCount = 0;
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        if (filters[field] != NULL)
+            filtered[filterCount++] = field;
+    }
+
+    for (size_t i = 0; i < entryCount; i++) {
+        if (!matchesFilters(&entries[i], filtered, filterCount))
+            continue;
+        internedString *text = entries[i].fields[groupField];
+        if (text->group == NULL)
+            text->group = createBucket(&buckets, text->text, text->hash);
+        text->group->totalCents = addMoney(text->group->totalCents, entries[i].cents);
+    }
+
+    if (sortMode == SORT_NAME)
+        sortBuckets(compareBucketCategory);
+    else if (sortMode == SORT_AMOUNT)
+        sortBuckets(compareBucketAmount);
 
     calculateTotals();
     printBuckets();
+    clearBuckets();
+
+    stringPool *pool = &fieldStrings[groupField];
+    for (size_t i = 0; i < pool->slotCount; i++) {
+        for (internedString *current = pool->slots[i]; current != NULL; current = current->nextInSlot)
+            current->group = NULL;
+    }
+}
+
+int parseField(const char* name)
+{
+    for (int field = 0; name != NULL && field < FIELD_COUNT; field++) {
+        if (strcmp(name, FIELD_NAMES[field]) == 0)
+            return field;
+    }
+    return -1;
+}
+
+void printInteractiveHelp(void)
+{
+    printf("Commands:\n");
+    printf("    filter FIELD TEXT     only use entries whose FIELD contains TEXT\n");
+    printf("    filter [FIELD]        remove the filter of FIELD or all filters\n");
+    printf("    group FIELD           group by day, category, comment, or month\n");
+    printf("    sort none|name|amount order of the rows\n");
+    printf("    width N|auto          width of the chart\n");
+    printf("    chart on|off          show a chart or percentages\n");
+    printf("    show                  print the report again\n");
+    printf("    quit                  leave bud\n");
+}
+
+// Executes one command, returns 0 if nothing has to be printed
+int runCommand(const char* command, const char* argument, const char* text)
+{
+    if (strcmp(command, "filter") == 0) {
+        int field = parseField(argument);
+        for (int i = 0; i < FIELD_COUNT; i++) {
+            if (argument == NULL || i == field) {
+                free(filters[i]);
+                filters[i] = (text != NULL ? strdup(text) : NULL);
+                applyFilter(i);
+            }
+        }
+        if (argument != NULL && field < 0) {
+            printf("Unknown field '%s'.\n", argument);
+            return 0;
+        }
+    } else if (strcmp(command, "group") == 0) {
+        int field = parseField(argument);
+        if (field < 0) {
+            printf("Usage: group day|category|comment|month\n");
+            return 0;
+        }
+        groupField = field;
+    } else if (strcmp(command, "sort") == 0) {
+        if (argument != NULL && strcmp(argument, "none") == 0)
+            sortMode = SORT_NONE;
+        else if (argument != NULL && strcmp(argument, "name") == 0)
+            sortMode = SORT_NAME;
+        else if (argument != NULL && strcmp(argument, "amount") == 0)
+            sortMode = SORT_AMOUNT;
+        else {
+            printf("Usage: sort none|name|amount\n");
+            return 0;
+        }
+    } else if (strcmp(command, "width") == 0) {
+        int width = (argument != NULL ? atoi(argument) : 0);
+        if (argument != NULL && strcmp(argument, "auto") == 0)
+            fixedChartwidth = 0;
+        else if (width > 0)
+            fixedChartwidth = min(MAX_CHART_SIZE, width);
+        else {
+            printf("Usage: width N|auto\n");
+            return 0;
+        }
+    } else if (strcmp(command, "chart") == 0) {
+        if (argument != NULL && strcmp(argument, "on") == 0)
+            nochart = 0;
+        else if (argument != NULL && strcmp(argument, "off") == 0)
+            nochart = 1;
+        else {
+            printf("Usage: chart on|off\n");
+            return 0;
+        }
+    } else if (strcmp(command, "help") == 0) {
+        printInteractiveHelp();
+        return 0;
+    } else if (strcmp(command, "show") != 0) {
+        printf("Unknown command '%s', type 'help' for a list of commands.\n", command);
+        return 0;
+    }
+    return 1;
+}
+
+// Reads commands from stdin, the entries stay in memory between commands
+void runInteractive(void)
+{
+    int prompt = isatty(0);
+    char line[BUFFERSIZE];
+
+    printQuery();
+    while (1) {
+        if (prompt) {
+            printf("bud> ");
+            fflush(stdout);
+        }
+        if (!fgets(line, BUFFERSIZE, stdin))
+            break;
+
+        char *command = strtok(line, SEPARATOR_CSV);
+        if (command == NULL)
+            continue;
+        if (strcmp(command, "quit") == 0 || strcmp(command, "exit") == 0)
+            break;
+        char *argument = strtok(NULL, SEPARATOR_CSV);
+        char *text = strtok(NULL, "\r\n");
+        if (text != NULL)
+            text += strspn(text, " \t");
+
+        if (runCommand(command, argument, text))
+            printQuery();
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    // Parse arguments
+    Argparser* argparser = Argparser_new();
+    Argparser_init(argparser, (ArgparserOption[]) {
+        ARGPARSER_OPT_HELP(),
+        ARGPARSER_OPT_BOOL('c', "color", &colorOutput, "display with colors"),
+        ARGPARSER_OPT_BOOL('i', "inverse", &inverse, "inverse the sign of all input"),
+        ARGPARSER_OPT_BOOL(0, "nochart", &nochart, "hide the chart"),
+        ARGPARSER_OPT_BOOL(0, "noheader", &noheader, "hide the header"),
+        ARGPARSER_OPT_BOOL(0, "nototal", &nototal, "hide the total"),
+        ARGPARSER_OPT_STRING_CALLBACK(0, "mem-limit", &memLimitArg, "spill categories to disk above this size, e.g. 64M", parseMemLimit),
+        ARGPARSER_OPT_INT(0, "max-errors", &maxErrors, "show at most this many parsing errors (default: 100)"),
+        ARGPARSER_OPT_STRING('r', "recursive", &recursiveDir, "read all files below a directory, sorted by date"),
+        ARGPARSER_OPT_STRING(0, "glob", &fileGlob, "file names read by --recursive (default: *.txt)"),
+        ARGPARSER_OPT_BOOL(0, "diff", &diffMode, "show changes per category between the files OLD and NEW"),
+        ARGPARSER_OPT_STRING(0, "cache", &cacheDir, "directory to cache the aggregates of --diff"),
+        ARGPARSER_OPT_BOOL(0, "interactive", &interactive, "load all files once and query them with commands from STDIN"),
+        ARGPARSER_OPT_STRING_CALLBACK(0, "rolling", &rollingArg, "report moving averages per month, e.g. 3m", parseRolling),
+        ARGPARSER_OPT_STRING_CALLBACK(0, "compare", &compareArg, "compare two periods, e.g. 2018-01,2018-02", parseCompare),
+        ARGPARSER_OPT_END(),
+    });
+    Argparser_setUsage(argparser, "bud [--inverse] [--noheader] [--color] [--nochart] [--nototal] [--mem-limit=SIZE]\n           [--max-errors=N] [-r DIR] [--glob=PATTERN] [--rolling=WINDOW] [--compare=OLD,NEW] FILE...\n       bud --diff [--cache=DIR] OLD NEW\n       bud --interactive [-r DIR] FILE...\n");
+    Argparser_setDescription(argparser, "Bud is a simple budget manager based on plain text files.\nIf no input FILE is given, it reads from STDIN.\nMonths are taken from file names (e.g. 2018-04.txt) or from full dates in the day column.\n");
+    argc = Argparser_parse(argparser, argc, argv);
+    Argparser_clear(argparser);
+    Argparser_delete(argparser);
+
+    if (memLimit > 0 && usePeriods) {
+        fprintf(stderr, "--mem-limit cannot be combined with --rolling or --compare\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (interactive && ((argc <= 0 && recursiveDir == NULL) || memLimit > 0 || usePeriods || diffMode)) {
+        fprintf(stderr, "--interactive expects FILE or -r DIR and no other reports\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (diffMode) {
+        if (argc != 2 || memLimit > 0 || usePeriods || recursiveDir != NULL) {
+            fprintf(stderr, "--diff expects two files OLD and NEW and no other inputs or reports\n");
+            exit(EXIT_FAILURE);
+        }
+        bucketTable oldTable = loadLedger(argv[0]);
+        bucketTable newTable = loadLedger(argv[1]);
+        summarizeParseErrors();
+        printDiff(&oldTable, &newTable);
+        return 0;
+    }
+
+    // Read from all files or stdin
+    if (argc <= 0 && recursiveDir == NULL)
+        processInput(stdin, -1);
+    for (int i = 0; i < argc; i++) {
+        FILE *input = openInput(argv[i]);
+        currentInput = argv[i];
+        processInput(input, findMonth(argv[i]));
+        fclose(input);
+    }
+    if (recursiveDir != NULL) {
+        collectInputFiles();
+        for (size_t i = 0; i < inputFileCount; i++) {
+            FILE *input = openInput(inputFiles[i].path);
+            currentInput = inputFiles[i].path;
+            processInput(input, inputFiles[i].month);
+            fclose(input);
+        }
+    }
+    summarizeParseErrors();
+
+    if (interactive) {
+        runInteractive();
+        return 0;
+    }
+
+    if (usePeriods) {
+        if (undatedEntries > 0)
+            fprintf(stderr, "WARNING: %ld entries without a month are ignored in period reports.\n", undatedEntries);
+        buildPrefixSums();
+        if (rollingMonths > 0)
+            printRolling();
+        if (rollingMonths > 0 && compareArg != NULL)
+            printf("\n");
+        if (compareArg != NULL)
+            printComparison();
+        return 0;
+    }
+
+    if (spillRunCount > 0) {
+        // Spill the remaining categories as well and merge all runs
+        spillBuckets();
+        mergeSpillRuns();
+        printSpilledBuckets();
+    } else {
+        calculateTotals();
+        printBuckets();
+    }
     return 0;
 }
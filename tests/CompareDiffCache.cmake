@@ -0,0 +1,86 @@
+# Runs bud --diff with a cold, warm, and damaged --cache and fails if the
+# reports differ from the uncached one.
+#
+# Usage:
+#   cmake -DBUD=<bud> -DOLD=<ledger> -DNEW=<ledger> -DWORK=<dir> -P CompareDiffCache.cmake
+#
+# The ledgers are copied into WORK, which also holds the cache directory.
+
+file(REMOVE_RECURSE "${WORK}")
+file(MAKE_DIRECTORY "${WORK}/cache")
+configure_file("${OLD}" "${WORK}/old.txt" COPYONLY)
+configure_file("${NEW}" "${WORK}/new.txt" COPYONLY)
+
+function(runDiff label)
+    execute_process(COMMAND "${BUD}" --nochart --diff ${ARGN} "${WORK}/old.txt" "${WORK}/new.txt"
+        OUTPUT_VARIABLE output ERROR_VARIABLE errors RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "bud --diff failed for the ${label} run (${result}): ${errors}")
+    endif()
+    set(output "${output}" PARENT_SCOPE)
+    set(errors "${errors}" PARENT_SCOPE)
+endfunction()
+
+function(expectReference label)
+    runDiff(${label} --cache=${WORK}/cache)
+    if(NOT output STREQUAL expected OR NOT errors STREQUAL expectedErrors)
+        message(FATAL_ERROR "The ${label} run differs from the uncached report:\n"
+            "${expected}${expectedErrors}\n---\n${output}${errors}")
+    endif()
+endfunction()
+
+runDiff(uncached)
+set(expected "${output}")
+set(expectedErrors "${errors}")
+
+expectReference(cold)
+file(GLOB caches "${WORK}/cache/*.cache")
+list(LENGTH caches cacheCount)
+if(NOT cacheCount EQUAL 2)
+    message(FATAL_ERROR "Expected one cache file per ledger, found ${cacheCount}")
+endif()
+expectReference(warm)
+
+# A warm run must take its totals from the cache, not from the ledgers
+set(written "")
+foreach(cache ${caches})
+    file(READ "${cache}" content)
+    list(APPEND written "${content}")
+    string(REGEX REPLACE "\n(-?[0-9]+ -?[0-9]+) [^\n]+" "\n\\1 Cached" content "${content}")
+    file(WRITE "${cache}" "${content}")
+endforeach()
+runDiff(modified --cache=${WORK}/cache)
+if(NOT output MATCHES "Cached")
+    message(FATAL_ERROR "The warm run did not read the cache:\n${output}")
+endif()
+
+# Truncated cache files are ignored, parsed again, and rewritten
+set(index 0)
+foreach(cache ${caches})
+    list(GET written ${index} content)
+    string(SUBSTRING "${content}" 0 100 truncated)
+    file(WRITE "${cache}" "${truncated}")
+    math(EXPR index "${index} + 1")
+endforeach()
+expectReference(truncated)
+set(index 0)
+foreach(cache ${caches})
+    file(READ "${cache}" content)
+    list(GET written ${index} original)
+    if(NOT content STREQUAL original)
+        message(FATAL_ERROR "The truncated cache '${cache}' was not rewritten")
+    endif()
+    math(EXPR index "${index} + 1")
+endforeach()
+
+# A changed ledger replaces its own cache entry
+file(APPEND "${WORK}/new.txt" "01  Appended  -1.00\n")
+runDiff(uncached)
+set(expected "${output}")
+set(expectedErrors "${errors}")
+expectReference(changed)
+file(GLOB caches "${WORK}/cache/*.cache")
+list(LENGTH caches cacheCount)
+if(NOT cacheCount EQUAL 2)
+    message(FATAL_ERROR "Expected the changed ledger to reuse its cache file, found ${cacheCount}")
+endif()
@@ -0,0 +1,34 @@
+# Runs bud with and without --mem-limit and fails if the reports differ.
+#
+# Usage:
+#   cmake -DBUD=<bud> -DINPUT=<ledger> -DLIMIT=<size> [-DGENERATE=<lines>] -P CompareMemLimit.cmake
+#
+# With GENERATE, INPUT is first written as a ledger of the given amount of
+# lines. Its categories repeat across many spilled runs and results.
+
+if(GENERATE)
+    set(content "")
+    foreach(i RANGE 1 ${GENERATE})
+        math(EXPR category "(${i} * 7919) % 3001")
+        math(EXPR euros "(${i} * 31) % 997 - 498")
+        math(EXPR cents "${i} % 90 + 10")
+        string(APPEND content "01  cat${category}  ${euros}.${cents}  generated\n")
+    endforeach()
+    file(WRITE "${INPUT}" "${content}")
+endif()
+
+execute_process(COMMAND "${BUD}" --nochart "${INPUT}"
+    OUTPUT_VARIABLE expected ERROR_VARIABLE expectedErrors RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "bud failed without --mem-limit (${result}): ${expectedErrors}")
+endif()
+
+execute_process(COMMAND "${BUD}" --nochart --mem-limit=${LIMIT} "${INPUT}"
+    OUTPUT_VARIABLE actual ERROR_VARIABLE actualErrors RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "bud failed with --mem-limit=${LIMIT} (${result}): ${actualErrors}")
+endif()
+
+if(NOT expected STREQUAL actual OR NOT expectedErrors STREQUAL actualErrors)
+    message(FATAL_ERROR "Reports differ with --mem-limit=${LIMIT}:\n${expected}\n---\n${actual}")
+endif()
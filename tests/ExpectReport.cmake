@@ -0,0 +1,27 @@
+# Runs bud on ledgers in DIR and fails if its report differs from the
+# expected one.
+#
+# Usage:
+#   cmake -DBUD=<bud> -DDIR=<dir> -DARGS="<arguments>" -DEXPECTED=<name> [-DRESULT=<code>] -P ExpectReport.cmake
+#
+# ARGS are split like a shell command line and run inside DIR, so error
+# messages name the ledgers relative to it. stdout and stderr must match
+# <name>.out and <name>.err in DIR, and the exit code must be RESULT (0).
+
+if(NOT DEFINED RESULT)
+    set(RESULT 0)
+endif()
+separate_arguments(arguments UNIX_COMMAND "${ARGS}")
+
+execute_process(COMMAND "${BUD}" ${arguments} WORKING_DIRECTORY "${DIR}"
+    OUTPUT_VARIABLE output ERROR_VARIABLE errors RESULT_VARIABLE result)
+file(READ "${DIR}/${EXPECTED}.out" expected)
+file(READ "${DIR}/${EXPECTED}.err" expectedErrors)
+
+if(NOT result EQUAL RESULT)
+    message(FATAL_ERROR "bud ${ARGS} exited with ${result} instead of ${RESULT}: ${errors}")
+endif()
+if(NOT output STREQUAL expected OR NOT errors STREQUAL expectedErrors)
+    message(FATAL_ERROR "Report of bud ${ARGS} differs from ${EXPECTED}:\n"
+        "${expected}${expectedErrors}\n---\n${output}${errors}")
+endif()